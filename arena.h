@@ -0,0 +1,68 @@
+#ifndef SIK_ROBAKI_ARENA_H
+#define SIK_ROBAKI_ARENA_H
+
+#include <memory_resource>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+/// Bump allocator for data of a single game.
+/// Memory is never freed one object at a time; reset() rewinds the arena in O(1)
+/// and keeps all its chunks, so later games reuse memory grown by earlier ones.
+class GameArena : public std::pmr::memory_resource {
+    static const size_t MIN_CHUNK_SIZE = 64 * 1024;
+
+    struct Chunk {
+        std::unique_ptr<std::byte[]> memory;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t current = 0;   // index of the chunk allocations are taken from
+    size_t used = 0;      // bytes used in the current chunk
+    size_t n_upstream = 0;
+
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        while (current < chunks.size()) {
+            // chunks are only aligned for new, so the address itself is aligned
+            auto base = reinterpret_cast<uintptr_t>(chunks[current].memory.get());
+            size_t start = (base + used + alignment - 1) / alignment * alignment - base;
+            if (start + bytes <= chunks[current].size) {
+                used = start + bytes;
+                return chunks[current].memory.get() + start;
+            }
+            current++;
+            used = 0;
+        }
+        size_t size = std::max(bytes + alignment, chunks.empty() ? MIN_CHUNK_SIZE : chunks.back().size * 2);
+        chunks.push_back(Chunk{std::unique_ptr<std::byte[]>(new std::byte[size]), size});
+        n_upstream++;
+        return do_allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *, size_t, size_t) override {
+        // memory is reclaimed by reset()
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+  public:
+    GameArena() = default;
+    GameArena(const GameArena &) = delete;
+    GameArena &operator=(const GameArena &) = delete;
+
+    void reset() {
+        current = 0;
+        used = 0;
+    }
+
+    /// number of chunks taken from the heap so far
+    size_t upstream_allocations() const {
+        return n_upstream;
+    }
+};
+
+#endif //SIK_ROBAKI_ARENA_H
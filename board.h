@@ -0,0 +1,68 @@
+#ifndef SIK_ROBAKI_BOARD_H
+#define SIK_ROBAKI_BOARD_H
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+/// Bitmap of eaten pixels, stored row by row.
+class Board {
+    const uint16_t width;
+    const uint16_t height;
+    std::vector<uint64_t> bits;
+
+    static void append_varint(std::vector<char> &out, uint32_t value) {
+        while (value >= 0x80) {
+            out.push_back((char) ((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back((char) value);
+    }
+
+  public:
+    Board(uint16_t width, uint16_t height)
+            : width(width), height(height), bits(((size_t) width * height + 63) / 64, 0) {}
+
+    bool is_set(int x, int y) const {
+        size_t i = (size_t) y * width + x;
+        return bits[i / 64] >> (i % 64) & 1;
+    }
+
+    void set(int x, int y) {
+        size_t i = (size_t) y * width + x;
+        bits[i / 64] |= (uint64_t) 1 << (i % 64);
+    }
+
+    void clear() {
+        std::fill(bits.begin(), bits.end(), 0);
+    }
+
+    /// appends run-length encoded board to out
+    /// runs of free and eaten pixels alternate, starting with free ones,
+    /// every run length is written as a LEB128 varint
+    void encode_rle(std::vector<char> &out) const {
+        const size_t n_bits = (size_t) width * height;
+        bool value = false;
+        uint32_t run = 0;
+        size_t i = 0;
+        while (i < n_bits) {
+            uint64_t word = bits[i / 64];
+            if (i % 64 == 0 && i + 64 <= n_bits && word == (value ? ~(uint64_t) 0 : 0)) {
+                // whole word continues current run
+                run += 64;
+                i += 64;
+                continue;
+            }
+            if ((bool) (word >> (i % 64) & 1) != value) {
+                append_varint(out, run);
+                value = !value;
+                run = 0;
+            }
+            run++;
+            i++;
+        }
+        append_varint(out, run);
+    }
+};
+
+#endif //SIK_ROBAKI_BOARD_H
@@ -1,9 +1,12 @@
 #include "utils.h"
 #include "server.h"
+#include "trace.h"
 
 
 int main(int argc, char *argv[]) {
     auto options = get_options(argc, argv);
+    TRACE_INSTALL();
+    TRACE_THREAD_NAME("simulation");
     Server server(options);
     server.run();
 }
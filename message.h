@@ -1,6 +1,8 @@
 #ifndef SIK_ROBAKI_MESSAGE_H
 #define SIK_ROBAKI_MESSAGE_H
 
+#include <memory_resource>
+
 #include "player.h"
 
 class DeserializationException : public std::exception {
@@ -15,9 +17,12 @@ enum EventType : uint8_t {
     PIXEL = 1,
     PLAYER_ELIMINATED = 2,
     GAME_OVER = 3,
-    WRONG_EVENT_TYPE = 4
+    BOARD_SNAPSHOT = 4,
+    WRONG_EVENT_TYPE = 5
 };
 
+/// Events are allocated in the per-game arena and their destructors are never
+/// called, so they may own only memory that comes from the same arena.
 class Event {
   protected:
     uint32_t length;
@@ -31,15 +36,17 @@ class Event {
         *(uint32_t *) (address + 4) = htonl(number);
         return 8;
     }
+
+    /// returns the number of bytes serialize() will write
+    virtual uint32_t size() const = 0;
 };
 
 class NewGameEvent : public Event {
     uint32_t width;
     uint32_t height;
-    std::vector<char> player_names;
-    uint32_t player_names_bytes;
+    std::pmr::vector<char> player_names;
   public:
-    NewGameEvent(uint32_t width, uint32_t height, std::vector<char> &&player_names)
+    NewGameEvent(uint32_t width, uint32_t height, std::pmr::vector<char> &&player_names)
             : Event(player_names.size() + 17, 0), width(width), height(height),
               player_names(std::move(player_names)) {}
 
@@ -53,6 +60,10 @@ class NewGameEvent : public Event {
         *(uint32_t *) (address + size) = htonl(calculate_crc32(address, size));
         return size + 4;
     }
+
+    uint32_t size() const override {
+        return player_names.size() + 21;
+    }
 };
 
 class PixelEvent : public Event {
@@ -72,6 +83,10 @@ class PixelEvent : public Event {
         *(uint32_t *) (address + 18) = htonl(calculate_crc32(address, 18));
         return 22;
     }
+
+    uint32_t size() const override {
+        return 22;
+    }
 };
 
 class PlayerEliminatedEvent : public Event {
@@ -87,6 +102,10 @@ class PlayerEliminatedEvent : public Event {
         *(uint32_t *) (address + 10) = htonl(calculate_crc32(address, 10));
         return 14;
     }
+
+    uint32_t size() const override {
+        return 14;
+    }
 };
 
 class GameOverEvent : public Event {
@@ -99,8 +118,53 @@ class GameOverEvent : public Event {
         *(uint32_t *) (address + 9) = htonl(calculate_crc32(address, 9));
         return 13;
     }
+
+    uint32_t size() const override {
+        return 13;
+    }
 };
 
+/// One piece of the board snapshot sent to clients joining a long game (protocol extension).
+///
+/// Event data: covered_events (4 bytes), offset (4 bytes), total_size (4 bytes), snapshot bytes.
+/// Chunks are numbered SNAPSHOT_EVENT_NUMBER + chunk index. Real event numbers never reach
+/// that value, since a game cannot have more events than pixels on a 32767x32767 board.
+/// So a chunk never collides with an event a client tracks, and clients unaware of
+/// BOARD_SNAPSHOT see it as an event from far ahead. Clients that reassemble the snapshot
+/// from offset and total_size have events [0, covered_events) and continue from
+/// covered_events. The snapshot starts with the number of players, then for every player
+/// 1 byte eliminated flag, 4 bytes x and 4 bytes y, followed by the board encoded as
+/// described in Board::encode_rle().
+class BoardSnapshotEvent : public Event {
+    uint32_t covered_events;
+    uint32_t offset;
+    uint32_t total_size;
+    const char *data;
+    uint32_t data_size;
+  public:
+    static const uint32_t SNAPSHOT_EVENT_NUMBER = 0x80000000;
+
+    BoardSnapshotEvent(uint32_t chunk, uint32_t covered_events, uint32_t offset, uint32_t total_size,
+                       const char *data, uint32_t data_size)
+            : Event(data_size + 17, SNAPSHOT_EVENT_NUMBER + chunk), covered_events(covered_events),
+              offset(offset), total_size(total_size), data(data), data_size(data_size) {}
+
+    uint32_t serialize(char *address) override {
+        Event::serialize(address);
+        *(uint8_t *) (address + 8) = BOARD_SNAPSHOT;
+        *(uint32_t *) (address + 9) = htonl(covered_events);
+        *(uint32_t *) (address + 13) = htonl(offset);
+        *(uint32_t *) (address + 17) = htonl(total_size);
+        std::memcpy(address + 21, data, data_size);
+        uint32_t size = data_size + 21;
+        *(uint32_t *) (address + size) = htonl(calculate_crc32(address, size));
+        return size + 4;
+    }
+
+    uint32_t size() const override {
+        return data_size + 25;
+    }
+};
 
 class ClientMessage {
   public:
@@ -8,6 +8,7 @@
 #include <cmath>
 
 #include "utils.h"
+#include "state.h"
 
 class ClientId {
   public:
@@ -23,6 +24,18 @@ class ClientId {
         }
         return port < other.port;
     }
+
+    void save_state(StateWriter &w) const {
+        w.put(address);
+        w.put(port);
+    }
+
+    static ClientId load_state(StateReader &r) {
+        struct sockaddr_in6 addr = {};
+        addr.sin6_addr = r.get<struct in6_addr>();
+        addr.sin6_port = r.get<in_port_t>();
+        return ClientId(addr);
+    }
 };
 
 enum PlayerState : uint8_t {
@@ -88,7 +101,7 @@ class Player {
     void update_time() {
         update_timestamp(time);
     }
-    PlayerState get_state() {
+    PlayerState get_state() const {
         return state;
     }
     void set_state(PlayerState s) {
@@ -108,6 +121,31 @@ class Player {
     void set_last_key(Direction dir) {
         last_key = dir;
     }
+
+    void save_state(StateWriter &w) const {
+        w.put(session_id);
+        w.put_string(name);
+        w.put(state);
+        w.put(last_key);
+        w.put(x);
+        w.put(y);
+        w.put(direction);
+    }
+
+    /// activity timer starts anew, clients get 2 seconds to reach the restarted server
+    static Player load_state(StateReader &r) {
+        auto session_id = r.get<uint64_t>();
+        std::string name = r.get_string();
+        Player p(session_id, STRAIGHT, std::move(name));
+        p.state = r.get<PlayerState>();
+        p.last_key = r.get<Direction>();
+        p.x = r.get<double>();
+        p.y = r.get<double>();
+        p.direction = r.get<int16_t>();
+        if (p.state > DISCONNECTED || p.last_key >= WRONG_DIRECTION)
+            throw StateException();
+        return p;
+    }
 };
 
 using PlayerMap = std::map<ClientId, Player>;
@@ -0,0 +1,146 @@
+#ifndef SIK_ROBAKI_RESEND_H
+#define SIK_ROBAKI_RESEND_H
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "player.h"
+
+/// Keeps track of events that lagging clients still need to receive.
+/// Instead of sending the whole tail of the event log at once, every client
+/// gets a limited number of datagrams per turn, newest events first.
+///
+/// Clients repeat their request until they catch up, so only events above
+/// the highest one already queued for the client are added to its pending
+/// ranges. After everything has been sent, the client is forgotten only
+/// after FORGET_AFTER_TURNS turns, so events lost on the way get sent again.
+///
+/// A client joining a long game may be sent a board snapshot instead of the
+/// events it covers, its parts go out before any pending events.
+class ResendScheduler {
+  public:
+    /// half-open range [from, to) of event numbers
+    struct Range {
+        uint32_t from;
+        uint32_t to;
+    };
+
+    struct PendingSnapshot {
+        std::shared_ptr<const std::vector<char>> data;   // null if there is no snapshot to send
+        uint32_t covered_events = 0;
+        uint32_t next_part = 0;
+    };
+
+    static const uint32_t FORGET_AFTER_TURNS = 10;
+
+  private:
+    struct Client {
+        std::vector<Range> ranges;   // disjoint and sorted, newest at the back
+        uint32_t queued_to = 0;      // events below it have already been queued
+        uint32_t idle_turns = 0;     // turns since all ranges have been sent
+        PendingSnapshot snapshot;
+
+        bool done() const {
+            return ranges.empty() && !snapshot.data;
+        }
+    };
+
+    std::map<ClientId, Client> pending;
+
+  public:
+    /// registers client's request for events [from, to)
+    void request(const ClientId &client, uint32_t from, uint32_t to) {
+        if (from >= to)
+            return;
+        auto[it, inserted] = pending.try_emplace(client);
+        Client &c = it->second;
+        if (inserted) {
+            c.ranges.push_back(Range{from, to});
+            c.queued_to = to;
+            return;
+        }
+
+        // client already has everything below from
+        auto first_needed = std::find_if(c.ranges.begin(), c.ranges.end(),
+                                         [from](const Range &r) { return r.to > from; });
+        c.ranges.erase(c.ranges.begin(), first_needed);
+        if (!c.ranges.empty())
+            c.ranges.front().from = std::max(c.ranges.front().from, from);
+
+        if (to <= c.queued_to)
+            return;   // repeated request
+        uint32_t start = std::max(from, c.queued_to);
+        if (!c.ranges.empty() && c.ranges.back().to == start)
+            c.ranges.back().to = to;
+        else
+            c.ranges.push_back(Range{start, to});
+        c.queued_to = to;
+        c.idle_turns = 0;
+    }
+
+    /// true while the client is being served or has been served recently
+    bool contains(const ClientId &client) const {
+        return pending.count(client) > 0;
+    }
+
+    /// registers a client which gets the snapshot of events [0, covered_events)
+    /// followed by events [covered_events, to)
+    /// ignored if the client is already known, so a snapshot is never sent twice at once
+    void request_snapshot(const ClientId &client, std::shared_ptr<const std::vector<char>> data,
+                          uint32_t covered_events, uint32_t to) {
+        auto[it, inserted] = pending.try_emplace(client);
+        if (!inserted)
+            return;
+        Client &c = it->second;
+        c.snapshot.data = std::move(data);
+        c.snapshot.covered_events = covered_events;
+        if (covered_events < to)
+            c.ranges.push_back(Range{covered_events, to});
+        c.queued_to = std::max(covered_events, to);
+    }
+
+    void cancel(const ClientId &client) {
+        pending.erase(client);
+    }
+
+    /// drops all pending requests, e.g. when a new game starts
+    void clear() {
+        pending.clear();
+    }
+
+    bool empty() const {
+        return pending.empty();
+    }
+
+    /// for every client sends at most datagrams_per_client datagrams
+    /// send_tail(client, from, to) sends one datagram with the newest events
+    /// from the range and returns the number of the first event it contained
+    /// send_snapshot_part(client, snapshot) sends part snapshot.next_part, advances it
+    /// and returns false if it was the last one
+    template<typename SendTail, typename SendSnapshotPart>
+    void run(uint16_t datagrams_per_client, SendTail send_tail, SendSnapshotPart send_snapshot_part) {
+        for (auto it = pending.begin(); it != pending.end();) {
+            Client &c = it->second;
+            uint16_t i = 0;
+            for (; i < datagrams_per_client && c.snapshot.data; i++) {
+                if (!send_snapshot_part(it->first, c.snapshot))
+                    c.snapshot.data.reset();
+            }
+            for (; i < datagrams_per_client && !c.ranges.empty(); i++) {
+                Range &r = c.ranges.back();
+                r.to = send_tail(it->first, r.from, r.to);
+                if (r.from >= r.to)
+                    c.ranges.pop_back();
+            }
+
+            if (c.done() && ++c.idle_turns >= FORGET_AFTER_TURNS)
+                it = pending.erase(it);
+            else
+                it++;
+        }
+    }
+};
+
+#endif //SIK_ROBAKI_RESEND_H
@@ -11,28 +11,52 @@
 #include <deque>
 #include <algorithm>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <csignal>
+#include <atomic>
+#include <thread>
+#include <chrono>
 
 #include "utils.h"
 #include "message.h"
 #include "player.h"
+#include "resend.h"
+#include "spsc_queue.h"
+#include "board.h"
+#include "trace.h"
+#include "state.h"
+#include "arena.h"
 
-using EventIt = std::vector<std::unique_ptr<Event>>::iterator;
+using EventVector = std::vector<Event *>;
+using EventIt = EventVector::iterator;
 
 class Game {
     const uint16_t turning_speed;
     const uint16_t width;
     const uint16_t height;
+    const uint32_t initial_seed;
     uint32_t seed;
-    std::vector<std::vector<bool>> board;
+    Board board;
+
+    // cached snapshot of the board and number of events it covers,
+    // replaced instead of overwritten while it is still being sent to someone
+    std::shared_ptr<std::vector<char>> snapshot;
+    uint32_t snapshot_events = 0;
+
+    // events of a single game live in the arena and are freed at once when the next
+    // game starts, the vectors below keep their capacity for the following games
+    GameArena arena;
     std::vector<PlayerMapIt> players;
-    std::vector<std::unique_ptr<Event>> events;
+    EventVector events;
 
     bool currently_being_played = false;
     uint32_t game_id = 0;
     uint8_t still_playing = 0;
+    bool first_call = true;
+    uint32_t generation = 0;   // changes whenever the event log is started anew
 
     uint32_t random() {
-        static bool first_call = true;
         if (first_call) {
             first_call = false;
             return seed;
@@ -44,18 +68,68 @@ class Game {
     bool is_position_valid(int x, int y) {
         if (x < 0 || y < 0 || x >= width || y >= height)
             return false;
-        return board[x][y];
+        return !board.is_set(x, y);
     }
 
     bool is_position_valid(std::pair<int, int> pos) {
         return is_position_valid(pos.first, pos.second);
     }
 
+    template<typename E, typename... Args>
+    void add_event(Args &&... args) {
+        void *memory = arena.allocate(sizeof(E), alignof(E));
+        events.push_back(new(memory) E(std::forward<Args>(args)...));
+    }
+
+    /// frees all memory of the previous game
+    void release_arena() {
+        players.clear();
+        events.clear();
+        arena.reset();
+    }
+
+    /// recreates an event from its serialized form, eaten pixels are marked on the board
+    void load_event(const char *data, uint32_t size) {
+        if (size < 13)
+            throw StateException();
+        uint32_t number = ntohl(*(uint32_t *) (data + 4));
+        switch (*(uint8_t *) (data + 8)) {
+            case NEW_GAME: {
+                if (size < 21)
+                    throw StateException();
+                std::pmr::vector<char> names(data + 17, data + size - 4, &arena);
+                add_event<NewGameEvent>(ntohl(*(uint32_t *) (data + 9)), ntohl(*(uint32_t *) (data + 13)),
+                                        std::move(names));
+                break;
+            }
+            case PIXEL: {
+                if (size != 22)
+                    throw StateException();
+                uint32_t x = ntohl(*(uint32_t *) (data + 10)), y = ntohl(*(uint32_t *) (data + 14));
+                if (x >= width || y >= height)
+                    throw StateException();
+                board.set(x, y);
+                add_event<PixelEvent>(number, *(uint8_t *) (data + 9), x, y);
+                break;
+            }
+            case PLAYER_ELIMINATED:
+                if (size != 14)
+                    throw StateException();
+                add_event<PlayerEliminatedEvent>(number, *(uint8_t *) (data + 9));
+                break;
+            case GAME_OVER:
+                add_event<GameOverEvent>(5, number);
+                break;
+            default:
+                throw StateException();
+        }
+    }
+
 
   public:
     explicit Game(const CliOptions &o) : turning_speed(o.turning_speed), width(o.width),
-                                         height(o.height), seed(o.seed),
-                                         board(o.width, std::vector<bool>(o.height, false)) {}
+                                         height(o.height), initial_seed(o.seed), seed(o.seed),
+                                         board(o.width, o.height) {}
 
     bool in_progress() const {
         return currently_being_played;
@@ -69,7 +143,7 @@ class Game {
         return events.begin() + number;
     }
 
-    const std::vector<std::unique_ptr<Event>> &get_events() {
+    const EventVector &get_events() {
         return events;
     }
 
@@ -80,18 +154,46 @@ class Game {
         return still_playing;
     }
 
+    uint32_t get_generation() const {
+        return generation;
+    }
+
+    /// drops the current game and restores the state from before the first one
+    void reset() {
+        release_arena();
+        board.clear();
+        snapshot.reset();
+        snapshot_events = 0;
+        currently_being_played = false;
+        seed = initial_seed;
+        first_call = true;
+        game_id = 0;
+        still_playing = 0;
+        generation++;
+    }
+
+    /// number of times the arena had to take memory from the heap
+    size_t arena_allocations() const {
+        return arena.upstream_allocations();
+    }
+
     /// returns iterator to first event
     EventIt start(std::vector<PlayerMapIt> &&new_players) {
+        release_arena();
+        board.clear();
+        snapshot_events = 0;
+        generation++;
         currently_being_played = true;
         still_playing = new_players.size();
-        players = std::move(new_players);
+        players.assign(new_players.begin(), new_players.end());
+        new_players.clear();
         game_id = random();
 
         static auto comp = [](const PlayerMapIt &i1, const PlayerMapIt &i2) {
             return i1->second.get_name() < i2->second.get_name();
         };
         std::sort(players.begin(), players.end(), comp);
-        std::vector<char> names;
+        std::pmr::vector<char> names(&arena);
         names.reserve(players.size() * 21);
         for (auto &it: players) {
             Player &p = it->second;
@@ -103,23 +205,24 @@ class Game {
             names.push_back('\0');
         }
 
-        auto event = std::make_unique<NewGameEvent>(width, height, std::move(names));
-        events.push_back(std::move(event));
+        add_event<NewGameEvent>(width, height, std::move(names));
         for (int i = 0; i < players.size(); i++) {
             Player &p = players[i]->second;
             auto[x, y] = p.get_position_int();
-            if (is_position_valid(x, y))
-                events.push_back(std::make_unique<PixelEvent>(i + 1, i, x, y));
-            else
-                events.push_back(std::make_unique<PlayerEliminatedEvent>(i + 1, i));
+            if (is_position_valid(x, y)) {
+                board.set(x, y);
+                add_event<PixelEvent>(i + 1, i, x, y);
+            } else
+                add_event<PlayerEliminatedEvent>(i + 1, i);
         }
         return events.begin();
     }
 
     /// returns iterator to the first event created inside this method
     EventIt process_turn() {
+        TRACE_SCOPE("process_turn");
         EventIt result = events.end() - 1;
-        int counter = players.size();
+        int counter = events.size();
         for (int i = 0; i < players.size(); i++) {
             Player &p = players[i]->second;
             switch (p.get_state()) {
@@ -134,9 +237,10 @@ class Game {
             if (old_x == new_x && old_y == new_y)
                 continue;
             if (is_position_valid(new_x, new_y)) {
-                events.push_back(std::make_unique<PixelEvent>(counter++, i, new_x, new_y));
+                board.set(new_x, new_y);
+                add_event<PixelEvent>(counter++, i, new_x, new_y);
             } else {
-                events.push_back(std::make_unique<PlayerEliminatedEvent>(counter++, i));
+                add_event<PlayerEliminatedEvent>(counter++, i);
                 p.set_state(ELIMINATED);
                 still_playing--;
                 if (still_playing == 1) {
@@ -148,15 +252,120 @@ class Game {
         return result + 1;
     }
 
+    void save_state(StateWriter &w) const {
+        w.put(width);
+        w.put(height);
+        w.put(seed);
+        w.put(first_call);
+        w.put(game_id);
+        w.put(currently_being_played);
+        w.put(still_playing);
+        w.put((uint32_t) players.size());
+        for (auto &it: players)
+            it->first.save_state(w);
+    }
+
+    /// writes events starting from number from, the log saved this way is read by load_state()
+    /// after the state written by save_state() and the number of events
+    void save_events(StateWriter &w, uint32_t from) const {
+        for (uint32_t i = from; i < events.size(); i++) {
+            uint32_t size = events[i]->size();
+            w.put(size);
+            events[i]->serialize(w.extend(size));
+        }
+    }
+
+    /// replaces current game with the saved one, players are looked up in all_players
+    void load_state(StateReader &r, PlayerMap &all_players) {
+        if (r.get<uint16_t>() != width || r.get<uint16_t>() != height)
+            throw StateException();  // board size has to match the one the game was started with
+        release_arena();
+        board.clear();
+        snapshot_events = 0;
+        generation++;
+        currently_being_played = false;
+        seed = r.get<uint32_t>();
+        first_call = r.get<bool>();
+        game_id = r.get<uint32_t>();
+        bool saved_in_progress = r.get<bool>();
+        still_playing = r.get<uint8_t>();
+
+        auto n_players = r.get<uint32_t>();
+        for (uint32_t i = 0; i < n_players; i++) {
+            auto it = all_players.find(ClientId::load_state(r));
+            if (it == all_players.end())
+                throw StateException();
+            players.push_back(it);
+        }
+        auto n_events = r.get<uint32_t>();
+        for (uint32_t i = 0; i < n_events; i++) {
+            auto size = r.get<uint32_t>();
+            load_event(r.get_bytes(size), size);
+        }
+        // set last, so a game that failed to load is never continued
+        currently_being_played = saved_in_progress;
+    }
+
+    /// returns snapshot of players' state and the board, rebuilt if new events appeared
+    /// players are described by their state byte and position, followed by the encoded board
+    std::shared_ptr<const std::vector<char>> get_snapshot() {
+        if (snapshot && snapshot_events == events.size())
+            return snapshot;
+
+        if (!snapshot || snapshot.use_count() > 1)
+            snapshot = std::make_shared<std::vector<char>>();
+        snapshot->clear();
+        snapshot->push_back((char) players.size());
+        for (auto &it: players) {
+            const Player &p = it->second;
+            auto[x, y] = p.get_position_int();
+            snapshot->push_back((char) (p.get_state() == ELIMINATED));
+            uint32_t pos[2] = {htonl(x), htonl(y)};
+            snapshot->insert(snapshot->end(), (char *) pos, (char *) (pos + 2));
+        }
+        board.encode_rle(*snapshot);
+        snapshot_events = events.size();
+        return snapshot;
+    }
+
+    /// number of events reflected in the last snapshot returned by get_snapshot()
+    uint32_t get_snapshot_events() const {
+        return snapshot_events;
+    }
+
 };
 
 
 class Server {
+    friend class ServerStateTest;   // tests/state_test.cpp checks saved and restored state
+
     static const uint32_t DATAGRAM_SIZE = 550;
     static const int MAX_PLAYERS = 25;
+    static const size_t QUEUE_SIZE = 1024;
+    // shorter games are cheaper to send event by event
+    static const uint32_t SNAPSHOT_MIN_EVENTS = 512;
+
+    struct InboundMessage {
+        ClientMessage message;
+        sockaddr_in6 addr;
+    };
+
+    struct OutboundDatagram {
+        sockaddr_in6 addr;
+        size_t length;
+        char data[DATAGRAM_SIZE];
+    };
 
     char buffer[2 * DATAGRAM_SIZE];
     const uint16_t rounds_per_sec;
+    const uint16_t resend_datagrams_per_turn;
+    const bool pipelined;
+    const bool snapshot_join;
+    const uint32_t state_snapshot_interval;
+    const std::string state_snapshot_path;
+    const bool resume;
+    const bool report_jitter;
+    const CpuAffinity affinity;
     int socket_num = 0;
     uint16_t port;
     uint8_t ready_to_play = 0;
@@ -164,49 +373,127 @@ class Server {
     std::vector<PlayerMapIt> waiting;
     std::deque<PlayerMapIt> player_queue;
     Game game;
+    ResendScheduler resends;
+    TickJitter jitter;
+
+    // used only in pipelined mode
+    std::unique_ptr<SpscQueue<InboundMessage, QUEUE_SIZE>> inbound;
+    std::unique_ptr<SpscQueue<OutboundDatagram, QUEUE_SIZE>> outbound;
+    std::unique_ptr<QueueSignal> inbound_signal;
+    std::unique_ptr<QueueSignal> outbound_signal;
+    std::thread receive_thread;
+    std::thread send_thread;
+    std::atomic<bool> stopping{false};
+
+    // state snapshots for warm restart, written on a separate thread
+    std::unique_ptr<SnapshotWriter> snapshot_writer;
+    std::vector<char> state_buffer;
+    std::vector<char> new_events_buffer;
+    uint32_t turns_since_snapshot = 0;
+    uint32_t logged_events = 0;        // events already handed over to the snapshot writer
+    uint32_t logged_generation = 0;    // game generation these events come from
+
+    static void pin_current_thread(int cpu) {
+        if (cpu < 0)
+            return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof set, &set) != 0)
+            std::cerr << "warning: could not pin thread to cpu " << cpu << "\n";
+    }
+
+    /// short pause for the simulation when the send thread falls behind
+    static void idle_wait() {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    /// signals are left to the simulation thread, so they can interrupt its waiting
+    static void block_signals() {
+        sigset_t all;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, nullptr);
+    }
 
     void send_data_in_buffer(size_t n_bytes, const ClientId &client) {
         sockaddr_in6 addr;
         addr.sin6_family = AF_INET6;
-        addr.sin6_port = htons(client.port);
+        addr.sin6_port = client.port;   // already in network byte order
         addr.sin6_addr = client.address;
         auto addr_length = (socklen_t) sizeof(addr);
 
-        if (sendto(socket_num, buffer, DATAGRAM_SIZE, 0, (struct sockaddr *) &addr, addr_length) < 0)
+        if (pipelined) {
+            TRACE_SCOPE("enqueue_datagram");
+            // datagram is handed over to the send thread
+            OutboundDatagram *slot;
+            while (!(slot = outbound->prepare_push()))
+                idle_wait();
+            slot->addr = addr;
+            slot->length = n_bytes;
+            std::memcpy(slot->data, buffer, n_bytes);
+            outbound->push();
+            outbound_signal->notify();
+            return;
+        }
+        TRACE_SCOPE("sendto");
+        if (sendto(socket_num, buffer, n_bytes, 0, (struct sockaddr *) &addr, addr_length) < 0)
             syserr("sendto");
 
     }
 
-    /// sends events to a concrete client starting from *event_it
-    /// if no client provided, they will be sent to all clients
-    void send_events(EventIt event_it, const ClientId *client = nullptr) {
-        *(uint32_t *) buffer = htonl(game.get_id());
+    /// sends one datagram with the newest events from range [from, to)
+    /// returns the number of the first event that has been sent
+    uint32_t send_events_tail(const ClientId &client, uint32_t from, uint32_t to) {
+        auto &events = game.get_events();
+        uint32_t first = to;
+        uint32_t size = 4;
+        while (first > from && size + events[first - 1]->size() <= DATAGRAM_SIZE) {
+            size += events[first - 1]->size();
+            first--;
+        }
+        if (first == to)
+            first--;   // single event larger than datagram, send it anyway
 
+        *(uint32_t *) buffer = htonl(game.get_id());
         uint32_t offset = 4;
-        for (auto it = event_it; it != game.get_events().end(); it++) {
-            auto &event = *it;
-            offset += event->serialize(buffer + offset);
-            if (offset >= DATAGRAM_SIZE) {
-                // whole datagram has been filled, it's time to send it
-                if (client) {
-                    send_data_in_buffer(DATAGRAM_SIZE, *client);
-                } else {
-                    for (auto &p_it: players)
-                        send_data_in_buffer(DATAGRAM_SIZE, p_it.first);
-                }
-                // overflow data needs to be moved to the start of buffer
-                offset -= DATAGRAM_SIZE;
-                std::memcpy(buffer, buffer + DATAGRAM_SIZE, offset);
-            }
+        {
+            TRACE_SCOPE("serialize");
+            for (uint32_t i = first; i < to; i++)
+                offset += events[i]->serialize(buffer + offset);
         }
-        if (offset > 0) {
-            if (client) {
-                send_data_in_buffer(offset, *client);
-            } else {
-                for (auto &p_it: players)
-                    send_data_in_buffer(offset, p_it.first);
-            }
+        send_data_in_buffer(offset, client);
+        return first;
+    }
+
+    /// sends one datagram of a snapshot, part 0 is the NEW_GAME event, the rest are snapshot chunks
+    /// returns false if it was the last part
+    bool send_snapshot_part(const ClientId &client, ResendScheduler::PendingSnapshot &snapshot) {
+        TRACE_SCOPE("send_snapshot_part");
+        static const uint32_t CHUNK_SIZE = DATAGRAM_SIZE - 4 - 25;
+        const std::vector<char> &data = *snapshot.data;
+        uint32_t part = snapshot.next_part++;
+
+        *(uint32_t *) buffer = htonl(game.get_id());
+        if (part == 0) {
+            send_data_in_buffer(4 + game.get_events()[0]->serialize(buffer + 4), client);
+            return true;
         }
+        uint32_t offset = (part - 1) * CHUNK_SIZE;
+        uint32_t chunk = std::min<uint32_t>(data.size() - offset, CHUNK_SIZE);
+        BoardSnapshotEvent event(part - 1, snapshot.covered_events, offset, data.size(), data.data() + offset, chunk);
+        send_data_in_buffer(4 + event.serialize(buffer + 4), client);
+        return offset + chunk < data.size();
+    }
+
+    void process_resends() {
+        TRACE_SCOPE("process_resends");
+        resends.run(resend_datagrams_per_turn,
+                    [this](const ClientId &client, uint32_t from, uint32_t to) {
+                        return send_events_tail(client, from, to);
+                    },
+                    [this](const ClientId &client, ResendScheduler::PendingSnapshot &snapshot) {
+                        return send_snapshot_part(client, snapshot);
+                    });
     }
 
     void check_activity() {
@@ -215,6 +502,7 @@ class Server {
             if (p.quiet_for_2s()) {
                 // player p has been quiet for too long and needs to be disconnected
                 p.set_state(DISCONNECTED);
+                resends.cancel(player_queue.front()->first);
                 player_queue.pop_front();
             } else {
                 break;
@@ -240,6 +528,7 @@ class Server {
     }
 
     void process_message(const ClientMessage &m, struct sockaddr_in6 &addr) {
+        TRACE_SCOPE("process_message");
         if (m.turn_direction >= WRONG_DIRECTION)
             return;
 
@@ -267,6 +556,7 @@ class Server {
         if (p.get_session_id() < m.session_id) { // player is "reconnected"
             PlayerState old_state = p.get_state();
             p.reset(m.session_id, m.turn_direction, m.player_name);
+            resends.cancel(clientId);   // new session starts from scratch, it has no events yet
             if (old_state != WAITING && old_state != READY)
                 waiting.push_back(i);
         } else {
@@ -277,7 +567,16 @@ class Server {
             if (n <= 0)
                 return; // no events to send
         }
-        send_events(game.get_event_iterator(m.next_expected_event_no), &clientId);
+        // a client already being served is not sent the snapshot again, it only gets new events
+        if (snapshot_join && m.next_expected_event_no == 0 && game.in_progress()
+            && game.num_of_events() >= SNAPSHOT_MIN_EVENTS && !resends.contains(clientId)) {
+            auto snapshot = game.get_snapshot();
+            resends.request_snapshot(clientId, std::move(snapshot), game.get_snapshot_events(),
+                                     game.num_of_events());
+            return;
+        }
+        // events are sent in process_resends(), a few datagrams per turn
+        resends.request(clientId, m.next_expected_event_no, game.num_of_events());
     }
 
     uint32_t calculate_turn_duration() {
@@ -285,60 +584,270 @@ class Server {
         return (uint32_t) milli_sec_per_turn;
     }
 
-    void receive_message() {
-        struct sockaddr_in6 client_addr;
+    /// reads one datagram from the socket using given buffer
+    /// returns false if the datagram is faulty and should be ignored
+    bool read_message(char *buf, ClientMessage &message, sockaddr_in6 &client_addr) {
         socklen_t add_size = sizeof client_addr;
-        auto length = recvfrom(socket_num, buffer, DATAGRAM_SIZE, 0,
-                               (struct sockaddr *) &client_addr, &add_size);
+        ssize_t length;
+        {
+            TRACE_SCOPE("recvfrom");
+            length = recvfrom(socket_num, buf, DATAGRAM_SIZE, 0,
+                              (struct sockaddr *) &client_addr, &add_size);
+        }
         if (length < 0)
             syserr("recvfrom");
         if (length == 0)
-            return;
+            return false;
 
-        ClientMessage message;
         try {
-            message.deserialize(buffer, length);
+            TRACE_SCOPE("deserialize");
+            message.deserialize(buf, length);
         } catch (DeserializationException &e) {
             // faulty datagram, it will be ignored
+            return false;
+        }
+        return true;
+    }
+
+    void receive_message() {
+        struct sockaddr_in6 client_addr;
+        ClientMessage message;
+        if (read_message(buffer, message, client_addr))
+            process_message(message, client_addr);
+    }
+
+    /// waits at most timeout_ms (forever if negative) for a message and processes it
+    /// returns false if no message arrived in time
+    bool handle_incoming(int timeout_ms) {
+        TRACE_POLL_DUMP();
+        if (!pipelined) {
+            struct pollfd poll_fd = {.fd=socket_num, .events = POLLIN};
+            int ret = poll(&poll_fd, 1, timeout_ms);
+            if (ret < 0 && errno == EINTR)
+                return true;    // interrupted by a signal, caller recalculates the timeout
+            if (ret < 0)
+                syserr("poll");
+            if (ret == 0)
+                return false;
+            receive_message();
+            return true;
+        }
+
+        Time time;
+        update_timestamp(time);
+        InboundMessage *in;
+        while (!(in = inbound->front())) {
+            TRACE_POLL_DUMP();
+            int remaining = -1;
+            if (timeout_ms >= 0) {
+                remaining = timeout_ms - (int) elapsed_time_ms(time);
+                if (remaining <= 0)
+                    return false;
+            }
+            inbound_signal->wait([this] { return inbound->front() != nullptr; }, remaining);
+        }
+        process_message(in->message, in->addr);
+        inbound->pop();
+        return true;
+    }
+
+    /// receive stage of the pipeline: parses datagrams into the inbound queue
+    void receive_loop() {
+        pin_current_thread(affinity.receive);
+        block_signals();
+        TRACE_THREAD_NAME("receive");
+        char recv_buffer[DATAGRAM_SIZE];
+        struct pollfd poll_fd = {.fd=socket_num, .events = POLLIN};
+        while (!stopping.load(std::memory_order_relaxed)) {
+            int ret = poll(&poll_fd, 1, 100);
+            if (ret < 0 && errno != EINTR)
+                syserr("poll");
+            if (ret <= 0)
+                continue;
+
+            InboundMessage *slot = inbound->prepare_push();
+            if (!slot) {
+                // simulation is too slow, datagram is dropped
+                InboundMessage dropped;
+                read_message(recv_buffer, dropped.message, dropped.addr);
+                continue;
+            }
+            if (read_message(recv_buffer, slot->message, slot->addr)) {
+                inbound->push();
+                inbound_signal->notify();
+            }
+        }
+    }
+
+    /// send stage of the pipeline: drains the outbound queue
+    void send_loop() {
+        pin_current_thread(affinity.send);
+        block_signals();
+        TRACE_THREAD_NAME("send");
+        while (true) {
+            OutboundDatagram *out = outbound->front();
+            if (!out) {
+                if (stopping.load())
+                    return;
+                outbound_signal->wait([this] { return outbound->front() || stopping.load(); }, -1);
+                continue;
+            }
+            {
+                TRACE_SCOPE("sendto");
+                if (sendto(socket_num, out->data, out->length, 0, (struct sockaddr *) &out->addr, sizeof out->addr) < 0)
+                    syserr("sendto");
+            }
+            outbound->pop();
+        }
+    }
+
+    void start_pipeline() {
+        inbound = std::make_unique<SpscQueue<InboundMessage, QUEUE_SIZE>>();
+        outbound = std::make_unique<SpscQueue<OutboundDatagram, QUEUE_SIZE>>();
+        inbound_signal = std::make_unique<QueueSignal>();
+        outbound_signal = std::make_unique<QueueSignal>();
+        receive_thread = std::thread(&Server::receive_loop, this);
+        send_thread = std::thread(&Server::send_loop, this);
+        pin_current_thread(affinity.simulation);
+    }
+
+    template<typename Container>
+    static void save_player_list(StateWriter &w, const Container &list) {
+        w.put((uint32_t) list.size());
+        for (auto &it: list)
+            it->first.save_state(w);
+    }
+
+    template<typename Container>
+    void load_player_list(StateReader &r, Container &list) {
+        auto n = r.get<uint32_t>();
+        for (uint32_t i = 0; i < n; i++) {
+            auto it = players.find(ClientId::load_state(r));
+            if (it == players.end())
+                throw StateException();
+            list.push_back(it);
+        }
+    }
+
+    void save_state(StateWriter &w) const {
+        w.put((uint32_t) players.size());
+        for (auto &[client, player]: players) {
+            client.save_state(w);
+            player.save_state(w);
+        }
+        save_player_list(w, waiting);
+        save_player_list(w, player_queue);
+        w.put(ready_to_play);
+        game.save_state(w);
+    }
+
+    void load_state(StateReader &r) {
+        auto n_players = r.get<uint32_t>();
+        for (uint32_t i = 0; i < n_players; i++) {
+            ClientId client = ClientId::load_state(r);
+            players.emplace(client, Player::load_state(r));
+        }
+        load_player_list(r, waiting);
+        load_player_list(r, player_queue);
+        ready_to_play = r.get<uint8_t>();
+        game.load_state(r, players);
+    }
+
+    /// serializes state and events since the previous snapshot on the game thread,
+    /// writing them is left to the snapshot writer
+    /// postponed to the next turn if the previous snapshot has not been taken by the writer yet
+    void save_state_snapshot() {
+        if (snapshot_writer->busy())
             return;
+        TRACE_SCOPE("save_state_snapshot");
+        turns_since_snapshot = 0;
+        bool new_log = logged_generation != game.get_generation();
+        if (new_log)
+            logged_events = 0;
+
+        state_buffer.clear();
+        StateWriter w(state_buffer);
+        save_state(w);
+        new_events_buffer.clear();
+        StateWriter events_writer(new_events_buffer);
+        game.save_events(events_writer, logged_events);
+
+        uint32_t n_events = game.num_of_events();
+        if (snapshot_writer->submit(state_buffer, new_events_buffer, n_events - logged_events, new_log)) {
+            logged_events = n_events;
+            logged_generation = game.get_generation();
         }
+    }
 
-        process_message(message, client_addr);
+    /// restores state saved in the snapshot file, starts from scratch if it cannot be read
+    void resume_from_snapshot() {
+        try {
+            MappedSnapshot snapshot(state_snapshot_path);
+            StateReader r = snapshot.reader();
+            load_state(r);
+        } catch (StateException &e) {
+            std::cerr << "cannot resume from " << state_snapshot_path << ", starting new server\n";
+            game.reset();
+            players.clear();
+            waiting.clear();
+            player_queue.clear();
+            ready_to_play = 0;
+        }
     }
 
     void process_game() {
         static const int turn_duration_ms = calculate_turn_duration();
-        struct pollfd poll_fd = {.fd=socket_num, .events = POLLIN};
         while (true) {
             // one loop iteration corresponds to one game turn
+            Time turn_start;
+            update_timestamp(turn_start);
             Time time;
             // TODO process turn
+            process_resends();
+            if (snapshot_writer && ++turns_since_snapshot >= state_snapshot_interval)
+                save_state_snapshot();
 
             int time_remaining = turn_duration_ms;
             update_timestamp(time);
-            while (int ret = poll(&poll_fd, 1, time_remaining)) {
+            while (handle_incoming(time_remaining)) {
                 // receive messages until next turn needs to be processed
-                if (ret < 0)
-                    syserr("poll");
-
-                receive_message();
                 time_remaining = std::max(turn_duration_ms - (int) elapsed_time_ms(time), 0);
             }
+
+            jitter.record(elapsed_time_us(turn_start), turn_duration_ms * 1000);
+            if (report_jitter && jitter.turns() >= 10u * rounds_per_sec)
+                jitter.report_and_reset();
         }
     }
 
   public:
-    Server(const CliOptions &o) : port(o.port), game(o), rounds_per_sec(o.rounds_per_sec) {}
+    Server(const CliOptions &o) : rounds_per_sec(o.rounds_per_sec),
+                                  resend_datagrams_per_turn(o.resend_datagrams_per_turn),
+                                  pipelined(o.pipelined), snapshot_join(o.snapshot_join),
+                                  state_snapshot_interval(o.state_snapshot_interval),
+                                  state_snapshot_path(o.state_snapshot_path), resume(o.resume),
+                                  report_jitter(o.report_jitter), affinity(o.affinity),
+                                  port(o.port), game(o) {
+        if (state_snapshot_interval > 0)
+            snapshot_writer = std::make_unique<SnapshotWriter>(state_snapshot_path);
+    }
 
     ~Server() {
+        stopping = true;
+        if (outbound_signal)
+            outbound_signal->wake();
+        if (receive_thread.joinable())
+            receive_thread.join();
+        if (send_thread.joinable())
+            send_thread.join();
         if (socket_num) {
             close(socket_num);
         }
     }
 
     void run() {
-        socket_num = socket(AF_INET6, SOCK_DGRAM, 0) < 0;
-        if (socket_num)
+        socket_num = socket(AF_INET6, SOCK_DGRAM, 0);
+        if (socket_num < 0)
             syserr("socket");
         // accept both ipv4 and ipv6
         int optval = 0;
@@ -357,10 +866,20 @@ class Server {
         if (bind(socket_num, (struct sockaddr *) &my_addr, sizeof my_addr) < 0)
             syserr("bind");
 
+        if (pipelined)
+            start_pipeline();
+
+        if (resume) {
+            resume_from_snapshot();
+            if (game.in_progress())
+                process_game();
+        }
+
         while (true) {
             while (waiting.size() < 2 || waiting.size() != ready_to_play) {
-                receive_message();
+                handle_incoming(-1);
             }
+            resends.clear();
             game.start(std::move(waiting));
 
             process_game();
@@ -0,0 +1,107 @@
+#ifndef SIK_ROBAKI_SPSC_QUEUE_H
+#define SIK_ROBAKI_SPSC_QUEUE_H
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstddef>
+#include <cerrno>
+
+#include "utils.h"
+
+/// Lock-free ring buffer for exactly one producer thread and one consumer thread.
+/// Capacity has to be a power of two.
+template<typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+    static const size_t CACHE_LINE = 64;
+
+    alignas(CACHE_LINE) std::atomic<size_t> head{0};   // next slot to read, owned by consumer
+    alignas(CACHE_LINE) std::atomic<size_t> tail{0};   // next slot to write, owned by producer
+    alignas(CACHE_LINE) T slots[Capacity];
+
+  public:
+    /// returns pointer to the slot the producer may fill or nullptr if queue is full
+    /// the element becomes visible to the consumer after push()
+    T *prepare_push() {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity)
+            return nullptr;
+        return &slots[t & (Capacity - 1)];
+    }
+
+    void push() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /// returns pointer to the oldest element or nullptr if queue is empty
+    /// the slot stays valid until pop()
+    T *front() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return nullptr;
+        return &slots[h & (Capacity - 1)];
+    }
+
+    void pop() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+/// Lets the consumer of a queue sleep until the producer pushes something.
+/// The producer makes a syscall only when the consumer is actually asleep.
+class QueueSignal {
+    int fd;
+    std::atomic<bool> waiting{false};
+
+    void drain() {
+        uint64_t value;
+        while (read(fd, &value, sizeof value) > 0);
+    }
+
+  public:
+    QueueSignal() {
+        fd = eventfd(0, EFD_NONBLOCK);
+        if (fd < 0)
+            syserr("eventfd");
+    }
+
+    QueueSignal(const QueueSignal &) = delete;
+    QueueSignal &operator=(const QueueSignal &) = delete;
+
+    ~QueueSignal() {
+        close(fd);
+    }
+
+    /// to be called by the producer after push()
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);   // pairs with the fence in wait()
+        if (waiting.load())
+            wake();
+    }
+
+    /// wakes the consumer regardless of the queue, e.g. when it should stop
+    void wake() {
+        uint64_t one = 1;
+        if (write(fd, &one, sizeof one) < 0 && errno != EAGAIN)
+            syserr("write(eventfd)");
+    }
+
+    /// blocks until ready() holds, wake() is called or timeout_ms passes (never if negative)
+    /// may return early, e.g. when interrupted by a signal, so the caller checks the queue again
+    template<typename Ready>
+    void wait(Ready ready, int timeout_ms) {
+        waiting.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready()) {
+            struct pollfd poll_fd = {.fd=fd, .events = POLLIN};
+            if (poll(&poll_fd, 1, timeout_ms) < 0 && errno != EINTR)
+                syserr("poll(eventfd)");
+        }
+        waiting.store(false);
+        drain();
+    }
+};
+
+#endif //SIK_ROBAKI_SPSC_QUEUE_H
@@ -0,0 +1,242 @@
+#ifndef SIK_ROBAKI_STATE_H
+#define SIK_ROBAKI_STATE_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+#include "utils.h"
+
+class StateException : public std::exception {
+};
+
+/// appends raw values to a buffer, used to save server state
+class StateWriter {
+    std::vector<char> &out;
+  public:
+    explicit StateWriter(std::vector<char> &out) : out(out) {}
+
+    template<typename T>
+    void put(const T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be written");
+        put_bytes((const char *) &value, sizeof value);
+    }
+
+    void put_bytes(const char *data, size_t n) {
+        out.insert(out.end(), data, data + n);
+    }
+
+    /// returns address of n new bytes at the end of the buffer, to be filled by the caller
+    char *extend(size_t n) {
+        out.resize(out.size() + n);
+        return out.data() + out.size() - n;
+    }
+
+    void put_string(const std::string &s) {
+        put((uint8_t) s.size());
+        put_bytes(s.data(), s.size());
+    }
+};
+
+/// reads values stored by StateWriter, throws StateException if data ends too early
+class StateReader {
+    const char *pos;
+    const char *end;
+  public:
+    StateReader(const char *data, size_t n) : pos(data), end(data + n) {}
+
+    template<typename T>
+    T get() {
+        T value;
+        std::memcpy(&value, get_bytes(sizeof value), sizeof value);
+        return value;
+    }
+
+    const char *get_bytes(size_t n) {
+        if ((size_t) (end - pos) < n)
+            throw StateException();
+        const char *result = pos;
+        pos += n;
+        return result;
+    }
+
+    std::string get_string() {
+        auto n = get<uint8_t>();
+        return std::string(get_bytes(n), n);
+    }
+};
+
+static const char SNAPSHOT_MAGIC[8] = {'S', 'I', 'K', 'S', 'N', 'A', 'P', 1};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t size;
+    uint32_t crc;
+};
+
+/// Writes snapshots to disk on its own thread.
+/// A snapshot consists of the state and the event log. Since the log only grows,
+/// the caller hands over just the events logged since its previous snapshot and
+/// the writer keeps the whole log. Buffers are passed by swapping, so no copying
+/// or allocation happens on the caller's side.
+/// File contents: header, state, number of logged events, logged events.
+class SnapshotWriter {
+    const std::string path;
+    std::vector<char> pending_state;
+    std::vector<char> pending_log;
+    uint32_t pending_log_events = 0;
+    bool pending_new_log = false;
+    bool has_pending = false;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+
+    // owned by the writer thread
+    std::vector<char> log;
+    uint32_t log_events = 0;
+
+    void write_file(const std::vector<char> &state) {
+        SnapshotHeader header;
+        std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof header.magic);
+        header.size = state.size() + sizeof log_events + log.size();
+        header.crc = calculate_crc32(state.data(), state.size());
+        header.crc = calculate_crc32((const char *) &log_events, sizeof log_events, header.crc);
+        header.crc = calculate_crc32(log.data(), log.size(), header.crc);
+
+        // written next to the old snapshot and renamed, so a crash never leaves a broken file
+        std::string tmp_path = path + ".tmp";
+        int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror("snapshot");
+            return;
+        }
+        bool ok = write(fd, &header, sizeof header) == sizeof header
+                  && write(fd, state.data(), state.size()) == (ssize_t) state.size()
+                  && write(fd, &log_events, sizeof log_events) == sizeof log_events
+                  && write(fd, log.data(), log.size()) == (ssize_t) log.size()
+                  && fsync(fd) == 0;
+        close(fd);
+        if (!ok || rename(tmp_path.c_str(), path.c_str()) < 0)
+            perror("snapshot");
+    }
+
+    void loop() {
+        std::vector<char> state;
+        std::vector<char> new_events;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this] { return has_pending || stopping; });
+            if (!has_pending)
+                return;
+            state.swap(pending_state);
+            new_events.swap(pending_log);
+            uint32_t n_new_events = pending_log_events;
+            bool new_log = pending_new_log;
+            has_pending = false;
+
+            lock.unlock();
+            if (new_log) {
+                log.clear();
+                log_events = 0;
+            }
+            log.insert(log.end(), new_events.begin(), new_events.end());
+            log_events += n_new_events;
+            new_events.clear();
+            write_file(state);
+            lock.lock();
+        }
+    }
+
+  public:
+    explicit SnapshotWriter(std::string path) : path(std::move(path)) {
+        calculate_crc32(nullptr, 0);  // builds crc table before another thread can use it
+        thread = std::thread(&SnapshotWriter::loop, this);
+    }
+
+    ~SnapshotWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+
+    /// true if the previous snapshot has not been taken by the writer thread yet
+    bool busy() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return has_pending;
+    }
+
+    /// hands state and n_new_events serialized events over to the writer thread,
+    /// the log is started anew if new_log is set
+    /// the buffers get old ones in their place, to be cleared and reused by the caller
+    /// returns false without touching the buffers if the previous snapshot is still waiting
+    bool submit(std::vector<char> &state, std::vector<char> &new_events, uint32_t n_new_events, bool new_log) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (has_pending)
+                return false;
+            pending_state.swap(state);
+            pending_log.swap(new_events);
+            pending_log_events = n_new_events;
+            pending_new_log = new_log;
+            has_pending = true;
+        }
+        cv.notify_one();
+        return true;
+    }
+};
+
+/// snapshot file mapped into memory, throws StateException if it is missing or damaged
+class MappedSnapshot {
+    void *address = MAP_FAILED;
+    size_t length = 0;
+  public:
+    explicit MappedSnapshot(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw StateException();
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(SnapshotHeader)) {
+            length = st.st_size;
+            address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (address == MAP_FAILED)
+            throw StateException();
+
+        const SnapshotHeader &header = *(const SnapshotHeader *) address;
+        if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof header.magic) != 0
+            || header.size != length - sizeof header
+            || header.crc != calculate_crc32(data(), header.size)) {
+            munmap(address, length);
+            throw StateException();
+        }
+    }
+
+    MappedSnapshot(const MappedSnapshot &) = delete;
+    MappedSnapshot &operator=(const MappedSnapshot &) = delete;
+
+    ~MappedSnapshot() {
+        munmap(address, length);
+    }
+
+    const char *data() const {
+        return (const char *) address + sizeof(SnapshotHeader);
+    }
+
+    StateReader reader() const {
+        return StateReader(data(), length - sizeof(SnapshotHeader));
+    }
+};
+
+#endif //SIK_ROBAKI_STATE_H
@@ -0,0 +1,50 @@
+#include <cassert>
+
+#include "../server.h"
+#include "test_utils.h"
+
+/// memory is aligned as requested, also beyond the alignment of new
+static void test_alignment() {
+    GameArena arena;
+    for (size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+        (void) arena.allocate(1, 1);   // leaves the next address unaligned
+        void *p = arena.allocate(24, alignment);
+        assert(reinterpret_cast<uintptr_t>(p) % alignment == 0);
+    }
+}
+
+/// once the arena has grown to fit a game, games that are not longer allocate nothing
+static void test_games_reuse_memory() {
+    CliOptions options;
+    options.seed = 1;
+    options.width = 2000;
+    options.height = 2000;
+    Game game(options);
+
+    PlayerMap all_players;
+    std::vector<PlayerMapIt> ids = add_players(all_players, 4);
+
+    size_t longest_game = 0;
+    int games_checked = 0;
+    for (int i = 0; i < 20; i++) {
+        for (auto &it: ids)
+            it->second.set_state(WAITING);
+        size_t before = game.arena_allocations();
+        game.start(std::vector<PlayerMapIt>(ids));
+        while (game.in_progress() && game.num_of_events() < 100000)
+            game.process_turn();
+
+        if (game.num_of_events() <= longest_game) {
+            assert(game.arena_allocations() == before);
+            games_checked++;
+        }
+        longest_game = std::max(longest_game, game.num_of_events());
+    }
+    assert(games_checked > 0);
+    assert(game.arena_allocations() > 1);  // games outgrew the first chunk
+}
+
+int main() {
+    test_alignment();
+    test_games_reuse_memory();
+}
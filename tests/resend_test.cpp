@@ -0,0 +1,154 @@
+#include <cassert>
+#include <set>
+
+#include "../resend.h"
+#include "test_utils.h"
+
+static bool no_snapshot(const ClientId &, ResendScheduler::PendingSnapshot &) {
+    assert(false);
+    return false;
+}
+
+/// every datagram carries at most 10 events
+static uint32_t send_ten(std::multiset<uint32_t> &sent, uint32_t from, uint32_t to) {
+    uint32_t first = std::max(from, to >= 10 ? to - 10 : 0);
+    for (uint32_t i = first; i < to; i++)
+        sent.insert(i);
+    return first;
+}
+
+static uint32_t next_expected(const std::multiset<uint32_t> &received) {
+    uint32_t n = 0;
+    while (received.count(n))
+        n++;
+    return n;
+}
+
+/// client repeating its request every other turn catches up and gets every event once
+static void test_repeated_requests_catch_up() {
+    ResendScheduler scheduler;
+    ClientId client = make_client(1);
+    std::multiset<uint32_t> sent;
+
+    uint32_t turn = 0;
+    for (; turn < 100 && next_expected(sent) < 1000; turn++) {
+        if (turn % 2 == 0)
+            scheduler.request(client, next_expected(sent), 1000);
+        scheduler.run(4, [&](const ClientId &, uint32_t from, uint32_t to) {
+            return send_ten(sent, from, to);
+        }, no_snapshot);
+    }
+    assert(next_expected(sent) == 1000);
+    assert(turn == 25);
+    for (uint32_t i = 0; i < 1000; i++)
+        assert(sent.count(i) == 1);
+}
+
+/// events appended while the backlog is sent are queued once and sent before older ones
+static void test_new_events_are_appended() {
+    ResendScheduler scheduler;
+    ClientId client = make_client(2);
+    std::vector<uint32_t> firsts;
+    auto send = [&](const ClientId &, uint32_t from, uint32_t to) {
+        uint32_t first = std::max(from, to >= 10 ? to - 10 : 0);
+        firsts.push_back(first);
+        return first;
+    };
+
+    scheduler.request(client, 0, 100);
+    scheduler.run(1, send, no_snapshot);       // sends [90, 100)
+    scheduler.request(client, 0, 120);
+    scheduler.request(client, 0, 120);
+    scheduler.run(3, send, no_snapshot);       // [110, 120), [100, 110), [80, 90)
+    assert((firsts == std::vector<uint32_t>{90, 110, 100, 80}));
+}
+
+/// once everything was sent and the client keeps asking, it is served again
+static void test_lost_events_are_resent() {
+    ResendScheduler scheduler;
+    ClientId client = make_client(3);
+    uint32_t n_sent = 0;
+    auto send = [&](const ClientId &, uint32_t from, uint32_t to) {
+        n_sent++;
+        return from;
+    };
+
+    scheduler.request(client, 0, 10);
+    scheduler.run(4, send, no_snapshot);
+    for (uint32_t i = 1; i < ResendScheduler::FORGET_AFTER_TURNS; i++) {
+        scheduler.request(client, 0, 10);
+        scheduler.run(4, send, no_snapshot);
+    }
+    assert(n_sent == 1);
+    assert(scheduler.empty());
+    scheduler.request(client, 0, 10);
+    scheduler.run(4, send, no_snapshot);
+    assert(n_sent == 2);
+}
+
+/// snapshot parts go out within the per-client limit, before events, and only once
+static void test_snapshot_is_paced_and_sent_once() {
+    ResendScheduler scheduler;
+    ClientId client = make_client(5);
+    auto data = std::make_shared<const std::vector<char>>(100);
+    std::vector<uint32_t> parts;
+    uint32_t events_sent = 0;
+    auto send_part = [&](const ClientId &, ResendScheduler::PendingSnapshot &snapshot) {
+        assert(snapshot.covered_events == 500);
+        parts.push_back(snapshot.next_part++);
+        return snapshot.next_part < 5;
+    };
+    auto send = [&](const ClientId &, uint32_t from, uint32_t to) {
+        uint32_t first = std::max(from, to - 2);
+        events_sent += to - first;
+        return first;
+    };
+
+    scheduler.request_snapshot(client, data, 500, 510);
+    scheduler.run(3, send, send_part);
+    assert(parts.size() == 3 && events_sent == 0);
+    scheduler.request_snapshot(client, data, 500, 510);   // repeated join is ignored
+    scheduler.request(client, 0, 512);
+    scheduler.run(3, send, send_part);
+    assert((parts == std::vector<uint32_t>{0, 1, 2, 3, 4}));
+    assert(events_sent == 2);    // [510, 512) first, newest events go out before older ones
+    scheduler.run(3, send, send_part);
+    assert(events_sent == 8);
+}
+
+/// client restarted with a new session is cancelled and served from 0 right away
+static void test_new_session_starts_over() {
+    ResendScheduler scheduler;
+    ClientId client = make_client(6);
+    std::multiset<uint32_t> sent;
+    auto send = [&](const ClientId &, uint32_t from, uint32_t to) {
+        return send_ten(sent, from, to);
+    };
+
+    scheduler.request(client, 0, 40);
+    scheduler.run(4, send, no_snapshot);
+    assert(sent.size() == 40);
+
+    scheduler.cancel(client);
+    assert(!scheduler.contains(client));   // may be offered a snapshot again
+    scheduler.request(client, 0, 40);
+    scheduler.run(4, send, no_snapshot);
+    for (uint32_t i = 0; i < 40; i++)
+        assert(sent.count(i) == 2);
+}
+
+static void test_cancel() {
+    ResendScheduler scheduler;
+    scheduler.request(make_client(4), 0, 10);
+    scheduler.cancel(make_client(4));
+    assert(scheduler.empty());
+}
+
+int main() {
+    test_repeated_requests_catch_up();
+    test_new_events_are_appended();
+    test_lost_events_are_resent();
+    test_snapshot_is_paced_and_sent_once();
+    test_new_session_starts_over();
+    test_cancel();
+}
@@ -0,0 +1,208 @@
+#include <cassert>
+
+#include "../server.h"
+#include "test_utils.h"
+
+static const char *PATH = "state_test.snapshot";
+
+static CliOptions make_options(uint16_t size) {
+    CliOptions options;
+    options.seed = 7;
+    options.width = size;
+    options.height = size;
+    options.state_snapshot_path = PATH;
+    return options;
+}
+
+static std::vector<char> serialized_events(const Game &game) {
+    std::vector<char> result;
+    StateWriter w(result);
+    game.save_events(w, 0);
+    return result;
+}
+
+template<typename Container>
+static std::vector<ClientId> client_ids(const Container &list) {
+    std::vector<ClientId> result;
+    for (auto &it: list)
+        result.push_back(it->first);
+    return result;
+}
+
+static bool operator==(const ClientId &a, const ClientId &b) {
+    return !(a < b) && !(b < a);
+}
+
+/// game saved in two incremental snapshots is restored with its whole event log
+static void test_game_restored() {
+    CliOptions options = make_options(200);
+    PlayerMap all_players;
+    Game game(options);
+    game.start(add_players(all_players, 3));
+
+    std::vector<char> state, new_events;
+    uint32_t logged = 0;
+    {
+        SnapshotWriter writer(PATH);
+        for (int snapshot = 0; snapshot < 2; snapshot++) {
+            for (int turn = 0; turn < 20 && game.in_progress(); turn++)
+                game.process_turn();
+            while (writer.busy());
+
+            state.clear();
+            StateWriter w(state);
+            game.save_state(w);
+            new_events.clear();
+            StateWriter events_writer(new_events);
+            game.save_events(events_writer, logged);
+            assert(writer.submit(state, new_events, game.num_of_events() - logged, snapshot == 0));
+            logged = game.num_of_events();
+        }
+    }   // writer finishes pending snapshot before it is destroyed
+
+    Game restored(options);
+    {
+        MappedSnapshot snapshot(PATH);
+        StateReader r = snapshot.reader();
+        restored.load_state(r, all_players);
+    }
+    assert(restored.num_of_events() == game.num_of_events());
+    assert(restored.get_id() == game.get_id());
+    assert(serialized_events(restored) == serialized_events(game));
+
+    // damaged snapshot is rejected
+    FILE *f = fopen(PATH, "r+");
+    fseek(f, -1, SEEK_END);
+    fputc('x', f);
+    fclose(f);
+    bool rejected = false;
+    try {
+        MappedSnapshot snapshot(PATH);
+    } catch (StateException &e) {
+        rejected = true;
+    }
+    assert(rejected);
+    remove(PATH);
+}
+
+/// player with a state or key out of range is rejected
+static void test_player_checked() {
+    Player player(3, LEFT, "worm");
+    player.set_state(ELIMINATED);
+    std::vector<char> saved;
+    StateWriter w(saved);
+    player.save_state(w);
+    StateReader r(saved.data(), saved.size());
+    Player restored = Player::load_state(r);
+    assert(restored.get_session_id() == 3 && restored.get_name() == "worm");
+    assert(restored.get_state() == ELIMINATED);
+
+    for (auto[state, key]: {std::pair<uint8_t, uint8_t>{DISCONNECTED + 1, STRAIGHT},
+                            std::pair<uint8_t, uint8_t>{WAITING, WRONG_DIRECTION}}) {
+        std::vector<char> broken;
+        StateWriter bw(broken);
+        bw.put((uint64_t) 1);
+        bw.put_string("worm");
+        bw.put(state);
+        bw.put(key);
+        bw.put(0.5);
+        bw.put(0.5);
+        bw.put((int16_t) 0);
+        StateReader br(broken.data(), broken.size());
+        bool rejected = false;
+        try {
+            Player::load_state(br);
+        } catch (StateException &e) {
+            rejected = true;
+        }
+        assert(rejected);
+    }
+}
+
+class ServerStateTest {
+    /// players 0-2 are in a game, player 3 is ready for the next one and 4 is waiting
+    static void fill(Server &server) {
+        auto ids = add_players(server.players, 5);
+        for (auto &it: ids)
+            server.player_queue.push_back(it);
+        ids[3]->second.set_state(READY);
+        server.waiting = {ids[3], ids[4]};
+        server.ready_to_play = 1;
+        server.game.start({ids[0], ids[1], ids[2]});
+        for (int turn = 0; turn < 20 && server.game.in_progress(); turn++)
+            server.game.process_turn();
+    }
+
+    static std::vector<char> saved_state(const Server &server) {
+        std::vector<char> result;
+        StateWriter w(result);
+        server.save_state(w);
+        return result;
+    }
+
+  public:
+    /// players, their lists and the game all come back from the snapshot file
+    static void test_server_restored() {
+        CliOptions options = make_options(200);
+        options.state_snapshot_interval = 1;
+        std::vector<char> state;
+        std::vector<char> events;
+        {
+            Server server(options);
+            fill(server);
+            server.save_state_snapshot();
+            state = saved_state(server);
+            events = serialized_events(server.game);
+        }   // snapshot is written before the server is destroyed
+
+        options.state_snapshot_interval = 0;
+        Server restored(options);
+        restored.resume_from_snapshot();
+        assert(restored.players.size() == 5);
+        assert(restored.players.at(make_client(1003)).get_state() == READY);
+        assert(client_ids(restored.waiting) == (std::vector<ClientId>{make_client(1003), make_client(1004)}));
+        assert(client_ids(restored.player_queue).size() == 5);
+        assert(restored.ready_to_play == 1);
+        assert(restored.game.in_progress());
+        assert(serialized_events(restored.game) == events);
+        assert(saved_state(restored) == state);
+        remove(PATH);
+    }
+
+    /// snapshot that passes the crc check but does not fit the server leaves it as a new one
+    static void test_failed_resume_resets() {
+        CliOptions options = make_options(200);
+        options.state_snapshot_interval = 1;
+        {
+            Server server(options);
+            fill(server);
+            server.save_state_snapshot();
+        }
+
+        CliOptions other_size = make_options(300);
+        Server server(other_size);
+        fill(server);   // state that has to be dropped
+        server.resume_from_snapshot();
+        assert(server.players.empty() && server.waiting.empty() && server.player_queue.empty());
+        assert(server.ready_to_play == 0);
+        assert(!server.game.in_progress());
+        assert(server.game.num_of_events() == 0);
+        assert(server.game.get_id() == 0);
+
+        // seed is back to the initial one, so the next game is the one a new server would play
+        PlayerMap players, fresh_players;
+        Game fresh(other_size);
+        server.game.start(add_players(players, 2));
+        fresh.start(add_players(fresh_players, 2));
+        assert(server.game.get_id() == fresh.get_id());
+        assert(serialized_events(server.game) == serialized_events(fresh));
+        remove(PATH);
+    }
+};
+
+int main() {
+    test_game_restored();
+    test_player_checked();
+    ServerStateTest::test_server_restored();
+    ServerStateTest::test_failed_resume_resets();
+}
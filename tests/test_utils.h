@@ -0,0 +1,26 @@
+#ifndef SIK_ROBAKI_TEST_UTILS_H
+#define SIK_ROBAKI_TEST_UTILS_H
+
+#include <string>
+#include <vector>
+
+#include "../player.h"
+
+/// client at address :: with the given port
+inline ClientId make_client(uint16_t port) {
+    struct sockaddr_in6 addr = {};
+    addr.sin6_port = htons(port);
+    return ClientId(addr);
+}
+
+/// adds n players named player0, player1, ... on ports 1000, 1001, ...
+inline std::vector<PlayerMapIt> add_players(PlayerMap &players, int n, Direction direction = STRAIGHT) {
+    std::vector<PlayerMapIt> result;
+    for (int i = 0; i < n; i++) {
+        auto it = players.emplace(make_client(1000 + i), Player(1, direction, "player" + std::to_string(i))).first;
+        result.push_back(it);
+    }
+    return result;
+}
+
+#endif //SIK_ROBAKI_TEST_UTILS_H
@@ -0,0 +1,150 @@
+#ifndef SIK_ROBAKI_TRACE_H
+#define SIK_ROBAKI_TRACE_H
+
+/// Tracing of the server loop phases, enabled by compiling with SIK_TRACE.
+/// Scoped spans are recorded into per-thread ring buffers and written in Chrome
+/// trace format (loadable in chrome://tracing or Perfetto) to trace-<pid>.json
+/// on SIGUSR1 and at exit. Without SIK_TRACE all macros expand to nothing.
+
+#ifdef SIK_TRACE
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <csignal>
+#include <unistd.h>
+
+namespace trace {
+
+struct Span {
+    const char *name;
+    uint64_t start_us;
+    uint64_t duration_us;
+};
+
+/// spans of a single thread, the oldest ones are overwritten when full
+struct ThreadBuffer {
+    static const size_t CAPACITY = 1 << 16;
+
+    const uint32_t tid;
+    const char *name = nullptr;
+    std::atomic<size_t> written{0};
+    std::vector<Span> spans;
+
+    explicit ThreadBuffer(uint32_t tid) : tid(tid), spans(CAPACITY) {}
+};
+
+inline std::mutex registry_mutex;
+inline std::vector<ThreadBuffer *> registry;   // buffers are never freed, threads may exit before dump
+inline volatile std::sig_atomic_t dump_requested = 0;
+
+inline ThreadBuffer *register_thread() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto *buffer = new ThreadBuffer(registry.size() + 1);
+    registry.push_back(buffer);
+    return buffer;
+}
+
+inline ThreadBuffer *local_buffer() {
+    thread_local ThreadBuffer *buffer = register_thread();
+    return buffer;
+}
+
+inline uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+class Scope {
+    const char *name;
+    uint64_t start;
+  public:
+    explicit Scope(const char *name) : name(name), start(now_us()) {}
+
+    ~Scope() {
+        ThreadBuffer *buffer = local_buffer();
+        size_t i = buffer->written.load(std::memory_order_relaxed);
+        buffer->spans[i % ThreadBuffer::CAPACITY] = {name, start, now_us() - start};
+        buffer->written.store(i + 1, std::memory_order_release);
+    }
+};
+
+inline void set_thread_name(const char *name) {
+    local_buffer()->name = name;
+}
+
+/// writes spans of all threads to trace-<pid>.json
+/// spans recorded concurrently with the dump may come out garbled
+inline void dump() {
+    char path[64];
+    snprintf(path, sizeof path, "trace-%d.json", (int) getpid());
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror("trace dump");
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    const char *separator = "";
+    fprintf(f, "{\"traceEvents\":[");
+    for (ThreadBuffer *buffer: registry) {
+        if (buffer->name) {
+            fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    separator, (int) getpid(), buffer->tid, buffer->name);
+            separator = ",";
+        }
+        size_t end = buffer->written.load(std::memory_order_acquire);
+        size_t begin = end > ThreadBuffer::CAPACITY ? end - ThreadBuffer::CAPACITY : 0;
+        for (size_t i = begin; i < end; i++) {
+            const Span &s = buffer->spans[i % ThreadBuffer::CAPACITY];
+            fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,\"pid\":%d,\"tid\":%u}",
+                    separator, s.name, (unsigned long) s.start_us, (unsigned long) s.duration_us,
+                    (int) getpid(), buffer->tid);
+            separator = ",";
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    fprintf(stderr, "trace written to %s\n", path);
+}
+
+/// to be called regularly from the main loop, dumps the trace if SIGUSR1 arrived
+inline void poll_dump() {
+    if (dump_requested) {
+        dump_requested = 0;
+        dump();
+    }
+}
+
+inline void install() {
+    struct sigaction action = {};
+    action.sa_handler = [](int) { dump_requested = 1; };
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+    std::atexit(dump);
+}
+
+} // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) trace::set_thread_name(name)
+#define TRACE_INSTALL() trace::install()
+#define TRACE_POLL_DUMP() trace::poll_dump()
+
+#else
+
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_THREAD_NAME(name) do {} while (0)
+#define TRACE_INSTALL() do {} while (0)
+#define TRACE_POLL_DUMP() do {} while (0)
+
+#endif //SIK_TRACE
+
+#endif //SIK_ROBAKI_TRACE_H
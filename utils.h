@@ -15,19 +15,16 @@
 #include <getopt.h>
 #include <string>
 #include <iostream>
+#include <algorithm>
 
 using Time = struct timeval;
 
 uint32_t elapsed_time_us(Time& prev_time) {
     Time curr_time;
-    gettimeofday(&prev_time, nullptr);
+    gettimeofday(&curr_time, nullptr);
 
-    int64_t diff = (curr_time.tv_usec - prev_time.tv_usec);
-    if (diff < 0) {
-        diff = -diff;
-        diff -= 1000000;
-    }
-    diff += (curr_time.tv_sec - prev_time.tv_sec) * 1000000;
+    int64_t diff = (int64_t) curr_time.tv_usec - prev_time.tv_usec;
+    diff += (int64_t) (curr_time.tv_sec - prev_time.tv_sec) * 1000000;
     return (uint32_t) diff;
 }
 
@@ -39,6 +36,31 @@ void update_timestamp(Time& timestamp) {
     gettimeofday(&timestamp, nullptr);
 }
 
+/// collects statistics of how much game turns overrun their planned duration
+class TickJitter {
+    uint64_t n_turns = 0;
+    uint64_t total_us = 0;
+    uint32_t max_us = 0;
+  public:
+    void record(uint32_t turn_us, uint32_t expected_us) {
+        uint32_t jitter = turn_us > expected_us ? turn_us - expected_us : expected_us - turn_us;
+        n_turns++;
+        total_us += jitter;
+        max_us = std::max(max_us, jitter);
+    }
+
+    uint64_t turns() const {
+        return n_turns;
+    }
+
+    void report_and_reset() {
+        if (n_turns > 0)
+            fprintf(stderr, "turns: %lu, mean jitter: %lu us, max jitter: %u us\n",
+                    (unsigned long) n_turns, (unsigned long) (total_us / n_turns), max_us);
+        n_turns = total_us = max_us = 0;
+    }
+};
+
 static uint32_t crc32_table[256];
 
 static void build_crc32_table(void) {
@@ -55,14 +77,15 @@ static void build_crc32_table(void) {
     }
 }
 
-uint32_t calculate_crc32(const char *s,size_t n) {
+/// prev is the checksum of preceding data, so that data written in pieces can be checksummed
+uint32_t calculate_crc32(const char *s,size_t n, uint32_t prev = 0) {
     static bool initialized = false;
     if(!initialized) {
         build_crc32_table();
         initialized = true;
     }
 
-    uint32_t crc=0xFFFFFFFF;
+    uint32_t crc=~prev;
     for(size_t i=0;i<n;i++) {
         char ch=s[i];
         uint32_t t=(ch^crc)&0xFF;
@@ -88,6 +111,13 @@ void syserr(const char *fmt, ...) {
     exit(EXIT_FAILURE);
 }
 
+/// cpus the pipeline stages are pinned to, -1 means no pinning
+struct CpuAffinity {
+    int receive = -1;
+    int simulation = -1;
+    int send = -1;
+};
+
 struct CliOptions {
     uint16_t port = 2021;
     int seed;
@@ -95,14 +125,27 @@ struct CliOptions {
     short rounds_per_sec = 50;
     short width = 640;
     short height = 480;
+    short resend_datagrams_per_turn = 4;
+    bool pipelined = false;
+    bool snapshot_join = false;
+    uint32_t state_snapshot_interval = 0;   // in turns, 0 disables snapshots
+    std::string state_snapshot_path = "screen-worms.snapshot";
+    bool resume = false;
+    bool report_jitter = false;
+    CpuAffinity affinity;
 
     CliOptions() { seed = time(nullptr); }
 };
 
 CliOptions get_options(int argc, char **argv) {
+    static const struct option long_options[] = {
+            {"resume",        no_argument,       nullptr, 'R'},
+            {"snapshot-file", required_argument, nullptr, 'F'},
+            {nullptr,         0,                 nullptr, 0}
+    };
     CliOptions options;
     while(true) {
-        switch (getopt(argc, argv, "p:ns:nt:nv:nw:nh:n")) {
+        switch (getopt_long(argc, argv, "p:ns:nt:nv:nw:nh:nr:nPja:nbS:n", long_options, nullptr)) {
             case 'p':
                 options.port = std::stoi(optarg);
                 break;
@@ -121,6 +164,38 @@ CliOptions get_options(int argc, char **argv) {
             case 'h':
                 options.height = std::stoi(optarg);
                 break;
+            case 'r': {
+                // with 0 lagging clients would never get anything
+                int datagrams = std::stoi(optarg);
+                if (datagrams < 1 || datagrams > UINT16_MAX)
+                    goto error;
+                options.resend_datagrams_per_turn = datagrams;
+                break;
+            }
+            case 'P':
+                options.pipelined = true;
+                break;
+            case 'b':
+                options.snapshot_join = true;
+                break;
+            case 'S':
+                options.state_snapshot_interval = std::stoi(optarg);
+                break;
+            case 'F':
+                options.state_snapshot_path = optarg;
+                break;
+            case 'R':
+                options.resume = true;
+                break;
+            case 'j':
+                options.report_jitter = true;
+                break;
+            case 'a':
+                // cpus for receive, simulation and send stage, e.g. -a 1,2,3
+                if (sscanf(optarg, "%d,%d,%d", &options.affinity.receive,
+                           &options.affinity.simulation, &options.affinity.send) != 3)
+                    goto error;
+                break;
             case -1:
                 return options;
             default:
@@ -128,7 +203,7 @@ CliOptions get_options(int argc, char **argv) {
         }
     }
     error:
-    std::cout << "Usage: ./screen-worms-server [-p n] [-s n] [-t n] [-v n] [-w n] [-h n]\n";
+    std::cout << "Usage: ./screen-worms-server [-p n] [-s n] [-t n] [-v n] [-w n] [-h n] [-r n] [-P] [-j] [-a n,n,n] [-b] [-S n] [--snapshot-file path] [--resume]\n";
     exit(1);
 }
 